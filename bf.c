@@ -24,8 +24,22 @@
 #include <stdbool.h>
 #include <string.h>
 
+#if defined(__GNUC__)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#endif
+
 #include "bf.h"
 
+#if defined(__GNUC__)
+#define BF_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define BF_ALWAYS_INLINE inline
+#endif
+
 void* bf_malloc(size_t size)
 {
     void *ptr = malloc(size);
@@ -38,12 +52,23 @@ void* bf_malloc(size_t size)
     return ptr;
 }
 
-void bf_cmd_init(bf_cmd_t *cmd, bf_cmd_type_t type, size_t value, size_t line, size_t column)
+void* bf_realloc(void *ptr, size_t size)
+{
+    void *new_ptr = realloc(ptr, size);
+    if (new_ptr == NULL && size != 0)
+    {
+        fprintf(stderr, "Memory allocation error.");
+        abort();
+    }
+
+    return new_ptr;
+}
+
+void bf_cmd_init(bf_cmd_t *cmd, bf_cmd_type_t type, size_t value)
 {
     cmd->type = type;
     cmd->value = value;
-    cmd->line = line;
-    cmd->column = column;
+    cmd->offset = 0;
     cmd->next_cmd = NULL;
     cmd->jump_cmd_target = NULL;
 }
@@ -103,13 +128,232 @@ bf_cmd_t* bf_cmd_stack_pop(bf_cmd_stack_t *stack)
     return NULL;
 }
 
+void bf_pos_table_init(bf_pos_table_t *table)
+{
+    table->entries = NULL;
+    table->length = 0;
+    table->capacity = 0;
+}
+
+void bf_pos_table_destroy(bf_pos_table_t *table)
+{
+    free(table->entries);
+    table->entries = NULL;
+    table->length = 0;
+    table->capacity = 0;
+}
+
+void bf_pos_table_push(bf_pos_table_t *table, bf_cmd_t *cmd, size_t pos)
+{
+    static const size_t SIZE_OF_POS_ENTRY_TYPE = sizeof(bf_pos_entry_t);
+
+    if (table->length == table->capacity)
+    {
+        table->capacity = (table->capacity > 0) ? table->capacity * 2 : 64;
+        table->entries = bf_realloc(table->entries, SIZE_OF_POS_ENTRY_TYPE * table->capacity);
+    }
+
+    table->entries[table->length].cmd = cmd;
+    table->entries[table->length].pos = pos;
+    ++(table->length);
+}
+
+bool bf_pos_table_find(bf_pos_table_t *table, bf_cmd_t *cmd, size_t *pos)
+{
+    size_t i;
+    for (i=0; i<table->length; ++i)
+    {
+        if (table->entries[i].cmd == cmd)
+        {
+            *pos = table->entries[i].pos;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void bf_source_position(const char *source, size_t pos, size_t *line, size_t *column)
+{
+    size_t line_offset = 0;
+    *line = 1;
+
+    size_t i;
+    for (i=0; i<pos; ++i)
+    {
+        if (source[i] == '\n')
+        {
+            line_offset = i + 1;
+            ++(*line);
+        }
+    }
+
+    *column = (pos - line_offset) + 1;
+}
+
+bf_cmd_t* bf_multiply_cmd_get(bf_cmd_t **first_cmd, bf_cmd_t **last_cmd, ptrdiff_t offset)
+{
+    static const size_t SIZE_OF_CMD_TYPE = sizeof(bf_cmd_t);
+
+    bf_cmd_t *cmd = *first_cmd;
+    while (cmd != NULL)
+    {
+        if (cmd->offset == offset)
+        {
+            return cmd;
+        }
+
+        cmd = cmd->next_cmd;
+    }
+
+    cmd = bf_malloc(SIZE_OF_CMD_TYPE);
+    bf_cmd_init(cmd, BF_CMD_MULTIPLY, 0);
+    cmd->offset = offset;
+    if (*last_cmd)
+    {
+        (*last_cmd)->next_cmd = cmd;
+    }
+    else
+    {
+        *first_cmd = cmd;
+    }
+
+    *last_cmd = cmd;
+    return cmd;
+}
+
+bool bf_optimize_loop(bf_cmd_t *loop_cmd)
+{
+    ptrdiff_t offset = 0;
+    ptrdiff_t min_offset = 0;
+    ptrdiff_t max_offset = 0;
+    unsigned char base_delta = 0;
+
+    bf_cmd_t *cmd = loop_cmd->next_cmd;
+    while (cmd->type != BF_CMD_JUMP_BACK)
+    {
+        switch (cmd->type)
+        {
+        case BF_CMD_INC_DATA_PTR:
+            offset += (ptrdiff_t)cmd->value;
+            if (offset > max_offset)
+            {
+                max_offset = offset;
+            }
+            break;
+        case BF_CMD_DEC_DATA_PTR:
+            offset -= (ptrdiff_t)cmd->value;
+            if (offset < min_offset)
+            {
+                min_offset = offset;
+            }
+            break;
+        case BF_CMD_INC_VALUE:
+            if (offset == 0)
+            {
+                base_delta += cmd->value;
+            }
+            break;
+        case BF_CMD_DEC_VALUE:
+            if (offset == 0)
+            {
+                base_delta -= cmd->value;
+            }
+            break;
+        default:
+            // I/O and nested loops stay interpreted
+            return false;
+        }
+
+        cmd = cmd->next_cmd;
+    }
+
+    // The number of iterations is only known when the current cell steps by one and the pointer ends where it started
+    if (offset != 0 || (base_delta != 1 && base_delta != 255))
+    {
+        return false;
+    }
+
+    bf_cmd_t *first_mul_cmd = NULL;
+    bf_cmd_t *last_mul_cmd = NULL;
+    bf_cmd_t *mul_cmd = NULL;
+    cmd = loop_cmd->next_cmd;
+    while (cmd->type != BF_CMD_JUMP_BACK)
+    {
+        switch (cmd->type)
+        {
+        case BF_CMD_INC_DATA_PTR:
+            offset += (ptrdiff_t)cmd->value;
+            break;
+        case BF_CMD_DEC_DATA_PTR:
+            offset -= (ptrdiff_t)cmd->value;
+            break;
+        case BF_CMD_INC_VALUE:
+            if (offset != 0)
+            {
+                mul_cmd = bf_multiply_cmd_get(&first_mul_cmd, &last_mul_cmd, offset);
+                mul_cmd->value += cmd->value;
+            }
+            break;
+        case BF_CMD_DEC_VALUE:
+            if (offset != 0)
+            {
+                mul_cmd = bf_multiply_cmd_get(&first_mul_cmd, &last_mul_cmd, offset);
+                mul_cmd->value -= cmd->value;
+            }
+            break;
+        default:
+            break;
+        }
+
+        cmd = cmd->next_cmd;
+    }
+
+    // The furthest cells the body reaches must be bounds checked even if their value doesn't change
+    if (min_offset < 0)
+    {
+        bf_multiply_cmd_get(&first_mul_cmd, &last_mul_cmd, min_offset);
+    }
+
+    if (max_offset > 0)
+    {
+        bf_multiply_cmd_get(&first_mul_cmd, &last_mul_cmd, max_offset);
+    }
+
+    // Counting up to zero runs the loop (256 - value) times, which negates the factors
+    mul_cmd = first_mul_cmd;
+    while (mul_cmd != NULL)
+    {
+        unsigned char factor = (unsigned char)mul_cmd->value;
+        if (base_delta == 1)
+        {
+            factor = -factor;
+        }
+
+        mul_cmd->value = factor;
+        mul_cmd = mul_cmd->next_cmd;
+    }
+
+    // The multiply commands go in front of the original body, which is kept for when the bounds check fails
+    if (first_mul_cmd)
+    {
+        last_mul_cmd->next_cmd = loop_cmd->next_cmd;
+        loop_cmd->next_cmd = first_mul_cmd;
+    }
+
+    loop_cmd->type = BF_CMD_MULTIPLY_LOOP;
+    return true;
+}
+
 void bf_env_init(bf_env_t *env, size_t num_of_data_cells, char *input)
 {
     env->data_cells = bf_malloc(sizeof(char) * num_of_data_cells);
     env->num_of_data_cells = num_of_data_cells;
+    env->max_num_of_data_cells = num_of_data_cells;
     env->data_ptr_idx = 0;
     env->input = input;
     env->input_idx = 0;
+    env->hot_loop_threshold = BF_DEFAULT_HOT_LOOP_THRESHOLD;
 
     size_t i;
     for (i=0; i<num_of_data_cells; ++i)
@@ -123,10 +367,136 @@ void bf_env_destroy(bf_env_t *env)
     free(env->data_cells);
     env->data_cells = NULL;
     env->num_of_data_cells = 0;
+    env->max_num_of_data_cells = 0;
     env->data_ptr_idx = 0;
     env->input = NULL;
 }
 
+bool bf_env_grow(bf_env_t *env, size_t num_of_data_cells)
+{
+    if (num_of_data_cells <= env->num_of_data_cells)
+    {
+        return true;
+    }
+
+    if (num_of_data_cells > env->max_num_of_data_cells)
+    {
+        return false;
+    }
+
+    // Doubling keeps pointer moves that walk off the end from reallocating every time
+    size_t new_num_of_data_cells = env->num_of_data_cells * 2;
+    if (new_num_of_data_cells < num_of_data_cells)
+    {
+        new_num_of_data_cells = num_of_data_cells;
+    }
+
+    if (new_num_of_data_cells > env->max_num_of_data_cells)
+    {
+        new_num_of_data_cells = env->max_num_of_data_cells;
+    }
+
+    env->data_cells = bf_realloc(env->data_cells, sizeof(char) * new_num_of_data_cells);
+    memset(env->data_cells + env->num_of_data_cells, 0, new_num_of_data_cells - env->num_of_data_cells);
+    env->num_of_data_cells = new_num_of_data_cells;
+    return true;
+}
+
+void bf_env_fit(bf_env_t *env, bf_cmd_t *root_cmd, size_t max_num_of_data_cells)
+{
+    size_t extent = 1;
+    if (bf_cmd_extent(root_cmd, &extent) && extent < max_num_of_data_cells)
+    {
+        max_num_of_data_cells = extent;
+    }
+
+    if (max_num_of_data_cells < env->num_of_data_cells)
+    {
+        max_num_of_data_cells = env->num_of_data_cells;
+    }
+
+    env->max_num_of_data_cells = max_num_of_data_cells;
+    bf_env_grow(env, (extent < max_num_of_data_cells) ? extent : max_num_of_data_cells);
+}
+
+bool bf_cmd_extent(bf_cmd_t *root_cmd, size_t *extent)
+{
+    static const size_t SIZE_OF_OFFSET_TYPE = sizeof(ptrdiff_t);
+
+    // Offsets of the pointer at each open loop, since a loop is only bounded if it ends where it started
+    ptrdiff_t *loop_offsets = NULL;
+    size_t num_of_loops = 0;
+    size_t loop_offsets_capacity = 0;
+
+    ptrdiff_t offset = 0;
+    ptrdiff_t max_offset = 0;
+    bool is_bounded = true;
+
+    bf_cmd_t *cmd = root_cmd;
+    while (cmd != NULL && is_bounded)
+    {
+        switch (cmd->type)
+        {
+        case BF_CMD_INC_DATA_PTR:
+            offset += (ptrdiff_t)cmd->value;
+            if (offset > max_offset)
+            {
+                max_offset = offset;
+            }
+            break;
+        case BF_CMD_DEC_DATA_PTR:
+            // Moving past the start is an error no matter the size, so it doesn't affect the extent
+            offset -= (ptrdiff_t)cmd->value;
+            break;
+        case BF_CMD_JUMP_FORWARD:
+            if (num_of_loops == loop_offsets_capacity)
+            {
+                loop_offsets_capacity = (loop_offsets_capacity > 0) ? loop_offsets_capacity * 2 : 16;
+                loop_offsets = bf_realloc(loop_offsets, SIZE_OF_OFFSET_TYPE * loop_offsets_capacity);
+            }
+
+            loop_offsets[num_of_loops] = offset;
+            ++num_of_loops;
+            break;
+        case BF_CMD_JUMP_BACK:
+            --num_of_loops;
+            is_bounded = (loop_offsets[num_of_loops] == offset);
+            break;
+        case BF_CMD_MULTIPLY_LOOP:
+        case BF_CMD_MULTIPLY:
+            // Only created while running
+            is_bounded = false;
+            break;
+        default:
+            break;
+        }
+
+        cmd = cmd->next_cmd;
+    }
+
+    free(loop_offsets);
+    if (is_bounded)
+    {
+        *extent = (size_t)max_offset + 1;
+    }
+
+    return is_bounded;
+}
+
+void bf_stats_init(bf_stats_t *stats)
+{
+    size_t i;
+    for (i=0; i<BF_NUM_OF_CMD_TYPES; ++i)
+    {
+        stats->cmds_executed[i] = 0;
+    }
+
+    stats->loop_entries = 0;
+    stats->loops_optimized = 0;
+    stats->input_bytes = 0;
+    stats->output_bytes = 0;
+}
+
 void bf_error(bf_status_t *status, bf_status_type_t type, size_t line, size_t column)
 {
     status->type = type;
@@ -134,78 +504,287 @@ void bf_error(bf_status_t *status, bf_status_type_t type, size_t line, size_t co
     status->column = column;
 }
 
-void bf_run(bf_status_t *status, char *source, bf_env_t *env)
+void bf_cmd_error(bf_status_t *status, bf_status_type_t type, bf_pos_table_t *positions, const char *source, bf_cmd_t *cmd)
 {
-    bf_cmd_t *root_cmd = bf_parse_str(status, source);
-    if (status->type == BF_STATUS_OK)
+    size_t pos = 0;
+    size_t line = 0;
+    size_t column = 0;
+    if (bf_pos_table_find(positions, cmd, &pos))
+    {
+        bf_source_position(source, pos, &line, &column);
+    }
+
+    bf_error(status, type, line, column);
+}
+
+// Shared by bf_exec and bf_exec_stats, inlining it with a constant stats pointer compiles the counting out of bf_exec
+static BF_ALWAYS_INLINE void bf_exec_cmds(bf_status_t *status, bf_cmd_t *root_cmd, bf_pos_table_t *positions,
+                                          const char *source, bf_env_t *env, bf_stats_t *stats)
+{
+    status->type = BF_STATUS_OK;
+
+    bf_cmd_t *cmd = root_cmd;
+    while (cmd != NULL)
     {
-        bf_cmd_t *cmd = root_cmd;
-        while (cmd != NULL)
+        if (stats)
         {
-            switch (cmd->type)
+            ++(stats->cmds_executed[cmd->type]);
+        }
+
+        switch (cmd->type)
+        {
+        case BF_CMD_NONE:
+        case BF_CMD_MULTIPLY:   // Only run by its multiply loop
+            break;
+        case BF_CMD_INC_DATA_PTR:
+            if ((env->data_ptr_idx + cmd->value) >= env->num_of_data_cells &&
+                !bf_env_grow(env, env->data_ptr_idx + cmd->value + 1))
             {
-            case BF_CMD_NONE:
-                break;
-            case BF_CMD_INC_DATA_PTR:
-                if ((env->data_ptr_idx + cmd->value) >= env->num_of_data_cells)
+                bf_cmd_error(status, BF_STATUS_DATA_PTR_OUT_OF_BOUNDS, positions, source, cmd);
+                return;
+            }
+
+            env->data_ptr_idx += cmd->value;
+            break;
+        case BF_CMD_DEC_DATA_PTR:
+            if (cmd->value > env->data_ptr_idx)
+            {
+                bf_cmd_error(status, BF_STATUS_DATA_PTR_OUT_OF_BOUNDS, positions, source, cmd);
+                return;
+            }
+
+            env->data_ptr_idx -= cmd->value;
+            break;
+        case BF_CMD_INC_VALUE:
+            env->data_cells[env->data_ptr_idx] += cmd->value;
+            break;
+        case BF_CMD_DEC_VALUE:
+            env->data_cells[env->data_ptr_idx] -= cmd->value;
+            break;
+        case BF_CMD_OUTPUT:
+            printf("%c", env->data_cells[env->data_ptr_idx]);
+            if (stats)
+            {
+                ++(stats->output_bytes);
+            }
+            break;
+        case BF_CMD_INPUT:
+            if (env->input)
+            {
+                env->data_cells[env->data_ptr_idx] = env->input[env->input_idx];
+                if (env->input[env->input_idx] != '\0' && env->input[env->input_idx + 1] != '\0')
                 {
-                    bf_error(status, BF_STATUS_DATA_PTR_OUT_OF_BOUNDS, cmd->line, cmd->column);
-                    return;
+                    ++(env->input_idx);
                 }
 
-                env->data_ptr_idx += cmd->value;
-                break;
-            case BF_CMD_DEC_DATA_PTR:
-                if (cmd->value > env->data_ptr_idx)
+                if (stats)
                 {
-                    bf_error(status, BF_STATUS_DATA_PTR_OUT_OF_BOUNDS, cmd->line, cmd->column);
-                    return;
+                    ++(stats->input_bytes);
+                }
+            }
+            break;
+        case BF_CMD_JUMP_FORWARD:
+            if (env->data_cells[env->data_ptr_idx] == 0)
+            {
+                cmd = cmd->jump_cmd_target;
+                continue;
+            }
+
+            if (cmd->value < env->hot_loop_threshold)
+            {
+                ++(cmd->value);
+                if (cmd->value == env->hot_loop_threshold && bf_optimize_loop(cmd))
+                {
+                    // Run this entry of the loop in its optimized form, where it's counted as a multiply loop instead
+                    if (stats)
+                    {
+                        --(stats->cmds_executed[BF_CMD_JUMP_FORWARD]);
+                        ++(stats->loops_optimized);
+                    }
+
+                    continue;
                 }
+            }
+
+            if (stats)
+            {
+                ++(stats->loop_entries);
+            }
+            break;
+        case BF_CMD_JUMP_BACK:
+            if (env->data_cells[env->data_ptr_idx] != 0)
+            {
+                cmd = cmd->jump_cmd_target;
+                continue;
+            }
+            break;
+        case BF_CMD_MULTIPLY_LOOP:
+            if (env->data_cells[env->data_ptr_idx] == 0)
+            {
+                cmd = cmd->jump_cmd_target;
+                continue;
+            }
 
-                env->data_ptr_idx -= cmd->value;
-                break;
-            case BF_CMD_INC_VALUE:
-                env->data_cells[env->data_ptr_idx] += cmd->value;
-                break;
-            case BF_CMD_DEC_VALUE:
-                env->data_cells[env->data_ptr_idx] -= cmd->value;
-                break;
-            case BF_CMD_OUTPUT:
-                printf("%c", env->data_cells[env->data_ptr_idx]);
-                break;
-            case BF_CMD_INPUT:
-                if (env->input)
+            if (stats)
+            {
+                ++(stats->loop_entries);
+            }
+
+            {
+                bf_cmd_t *body_cmd = cmd->next_cmd;
+                bool is_in_bounds = true;
+                while (body_cmd->type == BF_CMD_MULTIPLY)
                 {
-                    env->data_cells[env->data_ptr_idx] = env->input[env->input_idx];
-                    if (env->input[env->input_idx] != '\0' && env->input[env->input_idx + 1] != '\0')
+                    if ((body_cmd->offset < 0 && (size_t)(-body_cmd->offset) > env->data_ptr_idx) ||
+                        (body_cmd->offset > 0 && (env->data_ptr_idx + body_cmd->offset) >= env->num_of_data_cells))
                     {
-                        ++(env->input_idx);
+                        is_in_bounds = false;
                     }
+
+                    body_cmd = body_cmd->next_cmd;
                 }
-                break;
-            case BF_CMD_JUMP_FORWARD:
-                if (env->data_cells[env->data_ptr_idx] == 0)
+
+                if (!is_in_bounds)
                 {
-                    cmd = cmd->jump_cmd_target;
+                    // The original body reports the error from the right command
+                    cmd = body_cmd;
                     continue;
                 }
-                break;
-            case BF_CMD_JUMP_BACK:
-                if (env->data_cells[env->data_ptr_idx] != 0)
+
+                unsigned char value = env->data_cells[env->data_ptr_idx];
+                bf_cmd_t *mul_cmd = cmd->next_cmd;
+                while (mul_cmd != body_cmd)
                 {
-                    cmd = cmd->jump_cmd_target;
-                    continue;
+                    env->data_cells[env->data_ptr_idx + mul_cmd->offset] += value * mul_cmd->value;
+                    if (stats)
+                    {
+                        ++(stats->cmds_executed[BF_CMD_MULTIPLY]);
+                    }
+
+                    mul_cmd = mul_cmd->next_cmd;
                 }
-            }
 
-            cmd = cmd->next_cmd;
+                env->data_cells[env->data_ptr_idx] = 0;
+                cmd = cmd->jump_cmd_target;
+                continue;
+            }
         }
 
+        cmd = cmd->next_cmd;
+    }
+}
+
+void bf_exec(bf_status_t *status, bf_cmd_t *root_cmd, bf_pos_table_t *positions, const char *source, bf_env_t *env)
+{
+    bf_exec_cmds(status, root_cmd, positions, source, env, NULL);
+}
+
+void bf_exec_stats(bf_status_t *status, bf_cmd_t *root_cmd, bf_pos_table_t *positions, const char *source, bf_env_t *env,
+                   bf_stats_t *stats)
+{
+    bf_exec_cmds(status, root_cmd, positions, source, env, stats);
+}
+
+void bf_run(bf_status_t *status, char *source, bf_env_t *env)
+{
+    bf_pos_table_t positions;
+    bf_cmd_t *root_cmd = bf_parse_str(status, source, &positions);
+    if (status->type == BF_STATUS_OK)
+    {
+        bf_exec(status, root_cmd, &positions, source, env);
         bf_cmd_destroy(root_cmd);
+        bf_pos_table_destroy(&positions);
+    }
+}
+
+// Whether a source character is a command or a newline, everything else is a comment
+static inline bool bf_is_lexeme(char c)
+{
+    switch (c)
+    {
+    case '>':
+    case '<':
+    case '+':
+    case '-':
+    case '.':
+    case ',':
+    case '[':
+    case ']':
+    case '\n':
+        return true;
+    default:
+        return false;
     }
 }
 
-bf_cmd_t* bf_parse_str(bf_status_t *status, char *source)
+size_t bf_lex_next(const char *source, size_t pos, size_t length)
+{
+    // Dense code is the common case outside of comments, so check one character before going wide
+    if (pos < length && bf_is_lexeme(source[pos]))
+    {
+        return pos;
+    }
+
+    #if defined(__GNUC__) && defined(__AVX2__)
+    const __m256i wide_cmd_base = _mm256_set1_epi8('+');
+    const __m256i wide_cmd_range = _mm256_set1_epi8('.' - '+');
+    while (pos + 32 <= length)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(source + pos));
+
+        // '+', ',', '-' and '.' are contiguous, so they're matched with a single range check
+        __m256i offset = _mm256_sub_epi8(chunk, wide_cmd_base);
+        __m256i matches = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, wide_cmd_range), offset);
+        matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('>')));
+        matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('<')));
+        matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('[')));
+        matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(']')));
+        matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\n')));
+
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(matches);
+        if (mask != 0)
+        {
+            return pos + __builtin_ctz(mask);
+        }
+
+        pos += 32;
+    }
+    #endif
+
+    #if defined(__GNUC__) && defined(__SSE2__)
+    const __m128i cmd_base = _mm_set1_epi8('+');
+    const __m128i cmd_range = _mm_set1_epi8('.' - '+');
+    while (pos + 16 <= length)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(source + pos));
+
+        __m128i offset = _mm_sub_epi8(chunk, cmd_base);
+        __m128i matches = _mm_cmpeq_epi8(_mm_min_epu8(offset, cmd_range), offset);
+        matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('>')));
+        matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('<')));
+        matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('[')));
+        matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(']')));
+        matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')));
+
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(matches);
+        if (mask != 0)
+        {
+            return pos + __builtin_ctz(mask);
+        }
+
+        pos += 16;
+    }
+    #endif
+
+    while (pos < length && !bf_is_lexeme(source[pos]))
+    {
+        ++pos;
+    }
+
+    return pos;
+}
+
+bf_cmd_t* bf_parse_str(bf_status_t *status, char *source, bf_pos_table_t *positions)
 {
     static const size_t SIZE_OF_CMD_TYPE = sizeof(bf_cmd_t);
 
@@ -217,11 +796,13 @@ bf_cmd_t* bf_parse_str(bf_status_t *status, char *source)
 
     bf_cmd_stack_t jump_stack;
     bf_cmd_stack_init(&jump_stack);
+    bf_pos_table_init(positions);
 
-    size_t pos = 0;
+    size_t length = strlen(source);
+    size_t pos = bf_lex_next(source, 0, length);
     size_t line_offset = 0;
     size_t line = 1;
-    while (source[pos] != '\0')
+    while (pos < length)
     {
         char c = source[pos];
         bool is_optimized_cmd = false;
@@ -276,7 +857,7 @@ bf_cmd_t* bf_parse_str(bf_status_t *status, char *source)
             if (!is_optimized_cmd)
             {
                 cmd = bf_malloc(SIZE_OF_CMD_TYPE);
-                bf_cmd_init(cmd, current_type, 0, line, (pos - line_offset) + 1);
+                bf_cmd_init(cmd, current_type, 0);
                 if (current_type == BF_CMD_JUMP_FORWARD)
                 {
                     bf_cmd_stack_push(&jump_stack, cmd);
@@ -292,6 +873,7 @@ bf_cmd_t* bf_parse_str(bf_status_t *status, char *source)
                         // Error
                         bf_cmd_destroy(root_cmd);
                         bf_cmd_stack_destroy(&jump_stack);
+                        bf_pos_table_destroy(positions);
                         bf_error(status, BF_STATUS_UNEXPECTED_CLOSING_BRACKET, line, (pos - line_offset) + 1);
                         return NULL;
                     }
@@ -302,7 +884,11 @@ bf_cmd_t* bf_parse_str(bf_status_t *status, char *source)
                 if (current_type != prev_type)
                 {
                     cmd = bf_malloc(SIZE_OF_CMD_TYPE);
-                    bf_cmd_init(cmd, current_type, 1, line, (pos - line_offset) + 1);
+                    bf_cmd_init(cmd, current_type, 1);
+                    if (current_type == BF_CMD_INC_DATA_PTR || current_type == BF_CMD_DEC_DATA_PTR)
+                    {
+                        bf_pos_table_push(positions, cmd, pos);
+                    }
                 }
                 else
                 {
@@ -334,7 +920,7 @@ bf_cmd_t* bf_parse_str(bf_status_t *status, char *source)
             prev_type = current_type;
         }
 
-        ++pos;
+        pos = bf_lex_next(source, pos + 1, length);
     }
 
     if (jump_stack.length > 0)
@@ -342,6 +928,7 @@ bf_cmd_t* bf_parse_str(bf_status_t *status, char *source)
         // Error
         bf_cmd_destroy(root_cmd);
         bf_cmd_stack_destroy(&jump_stack);
+        bf_pos_table_destroy(positions);
         bf_error(status, BF_STATUS_UNCLOSED_BRACKET, line, (pos - line_offset) + 1);
         return NULL;
     }
@@ -24,6 +24,10 @@
 #define __BF_H__
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define BF_DEFAULT_HOT_LOOP_THRESHOLD 64
 
 typedef enum {
     BF_STATUS_OK,
@@ -41,9 +45,13 @@ typedef enum {
     BF_CMD_OUTPUT,          // .
     BF_CMD_INPUT,           // ,
     BF_CMD_JUMP_FORWARD,    // [
-    BF_CMD_JUMP_BACK        // ]
+    BF_CMD_JUMP_BACK,       // ]
+    BF_CMD_MULTIPLY_LOOP,   // A hot loop that was optimized while running
+    BF_CMD_MULTIPLY         // Only used inside of multiply loops
 } bf_cmd_type_t;
 
+#define BF_NUM_OF_CMD_TYPES (BF_CMD_MULTIPLY + 1)
+
 typedef struct {
     bf_status_type_t type;
     size_t line;        // For errors
@@ -53,9 +61,8 @@ typedef struct {
 // This data structure is used similarly to a linked list
 typedef struct bf_cmd {
     bf_cmd_type_t type;
-    size_t value;                   // Used for increment and decrement optimization
-    size_t line;
-    size_t column;
+    size_t value;                   // Used for increment and decrement optimization, and counts loop entries for jumps
+    ptrdiff_t offset;               // Only used for the multiply command
     struct bf_cmd *next_cmd;
     struct bf_cmd *jump_cmd_target;      // Only used for the jump commands
 } bf_cmd_t;
@@ -70,17 +77,43 @@ typedef struct {
     size_t length;
 } bf_cmd_stack_t;
 
+// Source positions are kept out of the commands since they're only needed for errors
+typedef struct {
+    bf_cmd_t *cmd;
+    size_t pos;         // Offset into the source
+} bf_pos_entry_t;
+
+// Only commands that can fail while running are recorded
+typedef struct {
+    bf_pos_entry_t *entries;
+    size_t length;
+    size_t capacity;
+} bf_pos_table_t;
+
+typedef struct {
+    size_t cmds_executed[BF_NUM_OF_CMD_TYPES];  // Indexed by bf_cmd_type_t
+    size_t loop_entries;
+    size_t loops_optimized;
+    size_t input_bytes;
+    size_t output_bytes;
+} bf_stats_t;
+
 typedef struct {
     unsigned char *data_cells;
     size_t num_of_data_cells;
+    size_t max_num_of_data_cells;   // The data cells grow up to this size when moving past the end
     size_t data_ptr_idx;
     char *input;
     size_t input_idx;       // To keep track of the index position for input commands
+    size_t hot_loop_threshold;  // Loop entries before a loop is optimized, 0 disables it
 } bf_env_t;
 
 // Allocates memory or aborts on failure
 void* bf_malloc(size_t size);
 
+// Reallocates memory or aborts on failure
+void* bf_realloc(void *ptr, size_t size);
+
 // Initializes a Brainfuck command stack
 void bf_cmd_stack_init(bf_cmd_stack_t *stack);
 
@@ -94,23 +127,72 @@ void bf_cmd_stack_push(bf_cmd_stack_t *stack, bf_cmd_t *cmd);
 bf_cmd_t* bf_cmd_stack_pop(bf_cmd_stack_t *stack);
 
 // Initializes a Brainfuck command struct
-void bf_cmd_init(bf_cmd_t *cmd, bf_cmd_type_t type, size_t value, size_t line, size_t column);
+void bf_cmd_init(bf_cmd_t *cmd, bf_cmd_type_t type, size_t value);
 
 // Frees the entire list of commands
 // NOTE: Should only ever be used on the root command node
 void bf_cmd_destroy(bf_cmd_t *root_cmd);
 
+// Initializes a source position table
+void bf_pos_table_init(bf_pos_table_t *table);
+
+// Frees the entries of a source position table
+void bf_pos_table_destroy(bf_pos_table_t *table);
+
+// Records the source offset of a command
+void bf_pos_table_push(bf_pos_table_t *table, bf_cmd_t *cmd, size_t pos);
+
+// Finds the source offset of a command, returns whether it was recorded
+bool bf_pos_table_find(bf_pos_table_t *table, bf_cmd_t *cmd, size_t *pos);
+
+// Converts an offset into the source to a line and column
+void bf_source_position(const char *source, size_t pos, size_t *line, size_t *column);
+
+// Finds the multiply command for an offset in a list, or appends a new one
+bf_cmd_t* bf_multiply_cmd_get(bf_cmd_t **first_cmd, bf_cmd_t **last_cmd, ptrdiff_t offset);
+
+// Rewrites a loop into a multiply loop if its body only moves and changes values, returns whether it did
+bool bf_optimize_loop(bf_cmd_t *loop_cmd);
+
 // Initializes an environment
 void bf_env_init(bf_env_t *env, size_t num_of_data_cells, char *input);
 
 // Frees the memory of a data array
 void bf_env_destroy(bf_env_t *env);
 
+// Grows the data cells to hold at least a number of cells, returns false if that's past the limit
+bool bf_env_grow(bf_env_t *env, size_t num_of_data_cells);
+
+// Sizes the data cells to the exact extent a program can reach when it can be proven,
+// otherwise they're left to grow up to the limit while running
+void bf_env_fit(bf_env_t *env, bf_cmd_t *root_cmd, size_t max_num_of_data_cells);
+
+// Finds the number of data cells a program can reach, returns false if the pointer isn't statically bounded
+bool bf_cmd_extent(bf_cmd_t *root_cmd, size_t *extent);
+
+// Clears all of the execution counters
+void bf_stats_init(bf_stats_t *stats);
+
 // Sets an error for a status
 void bf_error(bf_status_t *status, bf_status_type_t type, size_t line, size_t column);
 
-// Parses a brainfuck string
-bf_cmd_t* bf_parse_str(bf_status_t *status, char *source);
+// Sets an error at the recorded source position of a command
+void bf_cmd_error(bf_status_t *status, bf_status_type_t type, bf_pos_table_t *positions, const char *source, bf_cmd_t *cmd);
+
+// Returns the position of the next command or newline at or after pos, or length if there are none
+// Comment text is skipped 16 or 32 bytes at a time when SSE2 or AVX2 is available
+size_t bf_lex_next(const char *source, size_t pos, size_t length);
+
+// Parses a brainfuck string and fills in the source positions
+// NOTE: The position table is initialized here and must be destroyed by the caller on success
+bf_cmd_t* bf_parse_str(bf_status_t *status, char *source, bf_pos_table_t *positions);
+
+// Executes a list of parsed commands, the positions and source are only used for errors
+void bf_exec(bf_status_t *status, bf_cmd_t *root_cmd, bf_pos_table_t *positions, const char *source, bf_env_t *env);
+
+// Executes a list of parsed commands like bf_exec while collecting execution counters
+void bf_exec_stats(bf_status_t *status, bf_cmd_t *root_cmd, bf_pos_table_t *positions, const char *source, bf_env_t *env,
+                   bf_stats_t *stats);
 
 // Interprets a brainfuck string
 void bf_run(bf_status_t *status, char *source, bf_env_t *env);
@@ -1,3 +1,7 @@
+#if defined(__linux__)
+#define _GNU_SOURCE     // For syscall()
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -12,31 +16,60 @@
 #include <sys/stat.h>
 #include <errno.h>
 
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
 #include "bf.h"
 
 #define VERSION "1.0.1"
 #define DEFAULT_MEM_SIZE 30000
 #define MAX_INTERACTIVE_BUFFER_SIZE 2047
+#define NUM_OF_PERF_COUNTERS 4
 
 typedef enum {
     CMD_LINE_ARG_NONE = 0x00,
     CMD_LINE_ARG_INPUT = 0x01,
     CMD_LINE_ARG_INTERACTIVE_MODE = 0x02,
     CMD_LINE_ARG_MEM_SIZE = 0x04,
+    CMD_LINE_ARG_STATS = 0x08,
+    CMD_LINE_ARG_HOT_LOOP_THRESHOLD = 0x10,
 } cmd_line_flag_t;
 
 typedef struct {
     unsigned int flags;
     size_t mem_size;
+    size_t hot_loop_threshold;
     char *filename;
     char *input;
 } cmd_line_settings_t;
 
+typedef struct {
+    int fds[NUM_OF_PERF_COUNTERS];                      // -1 when a counter is unavailable
+    unsigned long long values[NUM_OF_PERF_COUNTERS];
+} perf_counters_t;
+
+typedef struct {
+    perf_counters_t parse_counters;
+    perf_counters_t run_counters;
+    bf_stats_t bf_stats;
+} run_stats_t;
+
+static const char *PERF_COUNTER_NAMES[NUM_OF_PERF_COUNTERS] = {
+    "cycles",
+    "instructions",
+    "branch-misses",
+    "cache-misses"
+};
+
 // Initializes a settings structure
 void cmd_line_settings_init(cmd_line_settings_t *settings)
 {
     settings->flags = 0;
     settings->mem_size = DEFAULT_MEM_SIZE;
+    settings->hot_loop_threshold = BF_DEFAULT_HOT_LOOP_THRESHOLD;
     settings->filename = NULL;
     settings->input = NULL;
 }
@@ -67,22 +100,206 @@ bool str_match(const char *str1, const char *str2)
 void print_help(const char *prog_name)
 {
     printf("\nUsage:\n");
-    printf("  %s [file_name] [-i <input> | --input <input>] [-s <size> | --mem-size <size>] [-I | --interactive]\n", prog_name);
+    printf("  %s [file_name] [-i <input> | --input <input>] [-s <size> | --mem-size <size>] [-I | --interactive] [-t <count> | --hot-loop <count>] [--stats]\n", prog_name);
     printf("  %s -v | --version\n", prog_name);
     printf("  %s -h | --help\n", prog_name);
     printf("\nOptions:\n");
     printf("  -i --input          Passes an input string.\n");
-    printf("  -s --mem-size       Sets the memory size.\n");
+    printf("  -s --mem-size       Sets the memory size, or the most memory the program can grow to.\n");
     printf("  -I --interactive    Enables interactive mode.\n");
+    printf("  -t --hot-loop       Sets how many entries a loop needs before it is optimized, 0 disables it.\n");
+    printf("  --stats             Prints performance counters and command counts after each run.\n");
     printf("  -v --version        Prints the version and exits.\n");
     printf("  -h --help           Prints this help message.\n");
 }
 
+// Opens the hardware performance counters, leaving unavailable ones disabled
+void perf_counters_init(perf_counters_t *counters)
+{
+    size_t i;
+    for (i=0; i<NUM_OF_PERF_COUNTERS; ++i)
+    {
+        counters->fds[i] = -1;
+        counters->values[i] = 0;
+    }
+
+    #if defined(__linux__)
+    static const unsigned long long CONFIGS[NUM_OF_PERF_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_CACHE_MISSES
+    };
+
+    for (i=0; i<NUM_OF_PERF_COUNTERS; ++i)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = CONFIGS[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        counters->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    #endif
+}
+
+// Closes the hardware performance counters
+void perf_counters_destroy(perf_counters_t *counters)
+{
+    size_t i;
+    for (i=0; i<NUM_OF_PERF_COUNTERS; ++i)
+    {
+        #if defined(__linux__)
+        if (counters->fds[i] != -1)
+        {
+            close(counters->fds[i]);
+        }
+        #endif
+
+        counters->fds[i] = -1;
+    }
+}
+
+// Resets and starts the available counters
+void perf_counters_start(perf_counters_t *counters)
+{
+    #if defined(__linux__)
+    size_t i;
+    for (i=0; i<NUM_OF_PERF_COUNTERS; ++i)
+    {
+        if (counters->fds[i] != -1)
+        {
+            ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    #endif
+}
+
+// Stops the available counters and reads their values
+void perf_counters_stop(perf_counters_t *counters)
+{
+    #if defined(__linux__)
+    size_t i;
+    for (i=0; i<NUM_OF_PERF_COUNTERS; ++i)
+    {
+        if (counters->fds[i] != -1)
+        {
+            unsigned long long value = 0;
+            ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(counters->fds[i], &value, sizeof(value)) == sizeof(value))
+            {
+                counters->values[i] = value;
+            }
+            else
+            {
+                close(counters->fds[i]);
+                counters->fds[i] = -1;
+            }
+        }
+    }
+    #endif
+}
+
+// Prints a single row of counter values, or n/a for unavailable ones
+void print_perf_counter(const char *name, perf_counters_t *parse_counters, perf_counters_t *run_counters, size_t idx)
+{
+    fprintf(stderr, "  %-16s", name);
+    if (parse_counters->fds[idx] != -1)
+    {
+        fprintf(stderr, " %16llu", parse_counters->values[idx]);
+    }
+    else
+    {
+        fprintf(stderr, " %16s", "n/a");
+    }
+
+    if (run_counters->fds[idx] != -1)
+    {
+        fprintf(stderr, " %16llu\n", run_counters->values[idx]);
+    }
+    else
+    {
+        fprintf(stderr, " %16s\n", "n/a");
+    }
+}
+
+// Prints the statistics for the last run
+void print_stats(run_stats_t *stats)
+{
+    static const char *CMD_NAMES[BF_NUM_OF_CMD_TYPES] = {
+        "none", ">", "<", "+", "-", ".", ",", "[", "]", "multiply loop", "multiply"
+    };
+
+    fflush(stdout);
+    fprintf(stderr, "\nPerformance counters %16s %16s\n", "parse", "run");
+    size_t i;
+    for (i=0; i<NUM_OF_PERF_COUNTERS; ++i)
+    {
+        print_perf_counter(PERF_COUNTER_NAMES[i], &stats->parse_counters, &stats->run_counters, i);
+    }
+
+    fprintf(stderr, "Commands executed\n");
+    for (i=BF_CMD_INC_DATA_PTR; i<BF_NUM_OF_CMD_TYPES; ++i)
+    {
+        fprintf(stderr, "  %-16s %16lu\n", CMD_NAMES[i], (unsigned long)stats->bf_stats.cmds_executed[i]);
+    }
+
+    fprintf(stderr, "  %-16s %16lu\n", "loop entries", (unsigned long)stats->bf_stats.loop_entries);
+    fprintf(stderr, "  %-16s %16lu\n", "loops optimized", (unsigned long)stats->bf_stats.loops_optimized);
+    fprintf(stderr, "  %-16s %16lu\n", "input bytes", (unsigned long)stats->bf_stats.input_bytes);
+    fprintf(stderr, "  %-16s %16lu\n", "output bytes", (unsigned long)stats->bf_stats.output_bytes);
+}
+
 // Runs a string of code and prints error messages if necessary
-void run_code(bf_env_t *env, char *source)
+// Statistics are collected and printed when stats is not NULL
+// The memory is first sized for the code up to max_mem_size, unless it's 0
+void run_code(bf_env_t *env, char *source, run_stats_t *stats, size_t max_mem_size)
 {
     bf_status_t status;
-    bf_run(&status, source, env);
+    bf_pos_table_t positions;
+    if (stats)
+    {
+        bf_stats_init(&stats->bf_stats);
+        perf_counters_start(&stats->parse_counters);
+    }
+
+    bf_cmd_t *root_cmd = bf_parse_str(&status, source, &positions);
+
+    if (stats)
+    {
+        perf_counters_stop(&stats->parse_counters);
+        perf_counters_start(&stats->run_counters);
+    }
+
+    if (status.type == BF_STATUS_OK)
+    {
+        if (max_mem_size > 0)
+        {
+            bf_env_fit(env, root_cmd, max_mem_size);
+        }
+
+        if (stats)
+        {
+            bf_exec_stats(&status, root_cmd, &positions, source, env, &stats->bf_stats);
+        }
+        else
+        {
+            bf_exec(&status, root_cmd, &positions, source, env);
+        }
+
+        bf_cmd_destroy(root_cmd);
+        bf_pos_table_destroy(&positions);
+    }
+
+    if (stats)
+    {
+        perf_counters_stop(&stats->run_counters);
+    }
+
     switch (status.type)
     {
     case BF_STATUS_OK:
@@ -96,6 +313,11 @@ void run_code(bf_env_t *env, char *source)
     case BF_STATUS_UNEXPECTED_CLOSING_BRACKET:
         fprintf(stderr, "\nUnexpected closing bracket: line %lu, col %lu\n", (unsigned long)status.line, (unsigned long)status.column);
     }
+
+    if (stats)
+    {
+        print_stats(stats);
+    }
 }
 
 // Handles command line arguments, returns whether to exit or not
@@ -103,6 +325,8 @@ bool handle_cmd_line_args(int argc, char **argv, cmd_line_settings_t *settings)
 {
     cmd_line_flag_t last_flag = CMD_LINE_ARG_NONE;
     unsigned long long mem_size;
+    unsigned long long hot_loop_threshold;
+    char *end;
     size_t i;
     for (i=1; i<argc; ++i)
     {
@@ -113,6 +337,27 @@ bool handle_cmd_line_args(int argc, char **argv, cmd_line_settings_t *settings)
             {
             case CMD_LINE_ARG_NONE:     // Suppress warning
             case CMD_LINE_ARG_INTERACTIVE_MODE:
+            case CMD_LINE_ARG_STATS:
+                break;
+            case CMD_LINE_ARG_HOT_LOOP_THRESHOLD:
+                // strtoull wraps negative numbers around instead of rejecting them
+                errno = 0;
+                hot_loop_threshold = strtoull(arg, &end, 10);
+                if (errno == ERANGE || hot_loop_threshold > SIZE_MAX)
+                {
+                    hot_loop_threshold = SIZE_MAX;
+                    errno = 0;
+                }
+
+                if (end != arg && *end == '\0' && strchr(arg, '-') == NULL)
+                {
+                    settings->hot_loop_threshold = hot_loop_threshold;
+                }
+                else
+                {
+                    // Error
+                    fprintf(stderr, "Invalid hot loop threshold, using default.\n");
+                }
                 break;
             case CMD_LINE_ARG_INPUT:
                 settings->flags |= CMD_LINE_ARG_INPUT;
@@ -160,6 +405,14 @@ bool handle_cmd_line_args(int argc, char **argv, cmd_line_settings_t *settings)
         {
             last_flag = CMD_LINE_ARG_MEM_SIZE;
         }
+        else if (str_match(arg, "-t") || str_match(arg, "--hot-loop"))
+        {
+            last_flag = CMD_LINE_ARG_HOT_LOOP_THRESHOLD;
+        }
+        else if (str_match(arg, "--stats"))
+        {
+            settings->flags |= CMD_LINE_ARG_STATS;
+        }
         else if (str_match(arg, "-h") || str_match(arg, "--help"))
         {
             printf("\nFooked Brainfuck Interpreter\n");
@@ -209,8 +462,22 @@ int main(int argc, char **argv)
         return 0;
     }
 
+    // A program that's run once gets the memory it can reach, with the memory size as the limit
+    // Interactive mode keeps the whole memory since later input can reach any of it
+    size_t max_mem_size = (settings.flags & CMD_LINE_ARG_INTERACTIVE_MODE) ? 0 : settings.mem_size;
+
     bf_env_t env;
-    bf_env_init(&env, settings.mem_size, settings.input);
+    bf_env_init(&env, (max_mem_size > 0) ? 0 : settings.mem_size, settings.input);
+    env.hot_loop_threshold = settings.hot_loop_threshold;
+
+    run_stats_t run_stats;
+    run_stats_t *stats = NULL;
+    if (settings.flags & CMD_LINE_ARG_STATS)
+    {
+        perf_counters_init(&run_stats.parse_counters);
+        perf_counters_init(&run_stats.run_counters);
+        stats = &run_stats;
+    }
 
     if (settings.filename)
     {
@@ -269,7 +536,7 @@ int main(int argc, char **argv)
                     fprintf(stderr, "Failed to close file '%s'.\n", settings.filename);
                 }
 
-                run_code(&env, file_data);
+                run_code(&env, file_data, stats, max_mem_size);
                 free(file_data);
             }
             else
@@ -286,13 +553,19 @@ int main(int argc, char **argv)
         get_interactive_input(&env, buffer, MAX_INTERACTIVE_BUFFER_SIZE);
         while (!str_match(buffer, "exit"))
         {
-            run_code(&env, buffer);
+            run_code(&env, buffer, stats, 0);
             get_interactive_input(&env, buffer, MAX_INTERACTIVE_BUFFER_SIZE);
         }
 
         free(buffer);
     }
 
+    if (stats)
+    {
+        perf_counters_destroy(&run_stats.parse_counters);
+        perf_counters_destroy(&run_stats.run_counters);
+    }
+
     bf_env_destroy(&env);
     return 0;
 }